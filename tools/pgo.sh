@@ -0,0 +1,73 @@
+#!/bin/sh
+# Two-stage profile-guided optimization build for violet
+# Usage: pgo.sh CMAKE SOURCE_DIR BUILD_DIR REFERENCE WORKLOAD LLVM_PROFDATA [CMAKE_ARGS...]
+#
+# Runs the workload on the REFERENCE violet binary, builds instrumented binaries in BUILD_DIR,
+# profiles them with the workload, rebuilds BUILD_DIR with the profile, then reports the
+# workload results for both the reference and the optimized binaries.
+
+set -e
+
+CMAKE=$1
+SOURCE_DIR=$2
+BUILD_DIR=$3
+REFERENCE=$4
+WORKLOAD=$5
+LLVM_PROFDATA=$6
+shift 6
+
+PORT=${PGO_PORT:-34780}
+RANGE=${PGO_RANGE:-34800:34999}
+CREDENTIALS=pgo:pgo
+PROFILE_DIR="$BUILD_DIR/profile"
+
+case "$LLVM_PROFDATA" in
+*NOTFOUND)
+	echo "llvm-profdata is required for PGO with Clang" >&2
+	exit 1
+	;;
+esac
+
+run_workload() {
+	"$1" --bind=127.0.0.1 --external=127.0.0.1 --port=$PORT --range=$RANGE \
+		--credentials=$CREDENTIALS --log-level=warn &
+	pid=$!
+	sleep 1
+	status=0
+	"$WORKLOAD" -a 127.0.0.1 -p $PORT -c $CREDENTIALS || status=$?
+	# Interrupting lets violet exit normally so the profile is written
+	kill -INT $pid
+	wait $pid || true
+	return $status
+}
+
+mkdir -p "$BUILD_DIR"
+
+echo "Running workload on reference build"
+run_workload "$REFERENCE" > "$BUILD_DIR/reference.txt"
+
+echo "Building instrumented binaries"
+rm -rf "$PROFILE_DIR"
+(cd "$BUILD_DIR" && "$CMAKE" "$@" -DPGO=GENERATE -DPGO_PROFILE_DIR="$PROFILE_DIR" "$SOURCE_DIR")
+"$CMAKE" --build "$BUILD_DIR" --target violet
+
+echo "Running workload on instrumented build"
+run_workload "$BUILD_DIR/violet" > /dev/null
+
+if [ -n "$LLVM_PROFDATA" ]; then
+	"$LLVM_PROFDATA" merge -output="$PROFILE_DIR/default.profdata" "$PROFILE_DIR"/*.profraw
+fi
+
+echo "Building optimized binaries"
+(cd "$BUILD_DIR" && "$CMAKE" "$@" -DPGO=USE -DPGO_PROFILE_DIR="$PROFILE_DIR" "$SOURCE_DIR")
+"$CMAKE" --build "$BUILD_DIR" --target violet
+
+echo "Running workload on optimized build"
+run_workload "$BUILD_DIR/violet" > "$BUILD_DIR/optimized.txt"
+
+echo
+echo "Reference build:"
+cat "$BUILD_DIR/reference.txt"
+echo
+echo "PGO build ($BUILD_DIR/violet):"
+cat "$BUILD_DIR/optimized.txt"
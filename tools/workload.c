@@ -0,0 +1,363 @@
+/*
+ * Copyright (c) 2021 Paul-Louis Ageneau
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Loopback workload for a running violet instance: STUN Binding requests, then rounds of
+// TURN allocations between two agents relaying messages to each other through the server.
+
+#include <juice/juice.h>
+
+#include <getopt.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BINDING_TIMEOUT_MS 100
+#define CONNECT_TIMEOUT_MS 10000
+#define STALL_TIMEOUT_MS 100
+#define RELAY_MESSAGE_SIZE 1000
+#define RELAY_WINDOW 32
+
+typedef struct workload_options {
+	const char *host;
+	uint16_t port;
+	const char *username;
+	const char *password;
+	int rounds;
+	int duration_ms;
+} workload_options_t;
+
+typedef struct workload_peer {
+	juice_agent_t *agent;
+	struct workload_peer *remote;
+	bool echo;
+	atomic_ulong received;
+} workload_peer_t;
+
+static uint64_t current_time_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void sleep_us(long us) {
+	struct timespec ts;
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = (us % 1000000) * 1000;
+	nanosleep(&ts, NULL);
+}
+
+static int run_binding(const workload_options_t *wopts) {
+	char service[8];
+	snprintf(service, 8, "%hu", wopts->port);
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	struct addrinfo *ai = NULL;
+	if (getaddrinfo(wopts->host, service, &hints, &ai) != 0) {
+		fprintf(stderr, "Unable to resolve \"%s\"\n", wopts->host);
+		return -1;
+	}
+
+	int sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (sock < 0 || connect(sock, ai->ai_addr, ai->ai_addrlen) != 0) {
+		fprintf(stderr, "Unable to connect to \"%s\"\n", wopts->host);
+		if (sock >= 0)
+			close(sock);
+		freeaddrinfo(ai);
+		return -1;
+	}
+	freeaddrinfo(ai);
+
+	unsigned long count = 0;
+	unsigned long lost = 0;
+	uint8_t request[20];
+	uint8_t response[1500];
+	uint64_t start = current_time_ms();
+	uint64_t end = start + wopts->duration_ms;
+	while (current_time_ms() < end) {
+		// Binding request with magic cookie and random transaction id, no attributes
+		memset(request, 0, sizeof(request));
+		request[1] = 0x01;
+		request[4] = 0x21;
+		request[5] = 0x12;
+		request[6] = 0xA4;
+		request[7] = 0x42;
+		for (int i = 8; i < 20; ++i)
+			request[i] = (uint8_t)rand();
+
+		if (send(sock, request, sizeof(request), 0) < 0) {
+			fprintf(stderr, "Sending Binding request failed\n");
+			close(sock);
+			return -1;
+		}
+
+		bool answered = false;
+		struct pollfd pfd;
+		pfd.fd = sock;
+		pfd.events = POLLIN;
+		while (!answered && poll(&pfd, 1, BINDING_TIMEOUT_MS) > 0) {
+			ssize_t len = recv(sock, response, sizeof(response), 0);
+			if (len >= 20 && response[0] == 0x01 && response[1] == 0x01 &&
+			    memcmp(response + 8, request + 8, 12) == 0)
+				answered = true;
+		}
+
+		if (answered)
+			++count;
+		else
+			++lost;
+	}
+
+	double elapsed = (double)(current_time_ms() - start) / 1000.0;
+	printf("Binding: %lu requests (%lu lost), %.0f requests/s\n", count, lost,
+	       count / elapsed);
+
+	close(sock);
+	return 0;
+}
+
+static void on_candidate(juice_agent_t *agent, const char *sdp, void *user_ptr) {
+	(void)agent;
+	workload_peer_t *peer = user_ptr;
+
+	// Keep only relayed candidates so that traffic goes through the server
+	if (!strstr(sdp, " typ relay"))
+		return;
+
+	juice_add_remote_candidate(peer->remote->agent, sdp);
+}
+
+static void on_gathering_done(juice_agent_t *agent, void *user_ptr) {
+	(void)agent;
+	workload_peer_t *peer = user_ptr;
+	juice_set_remote_gathering_done(peer->remote->agent);
+}
+
+static void on_recv(juice_agent_t *agent, const char *data, size_t size, void *user_ptr) {
+	workload_peer_t *peer = user_ptr;
+	atomic_fetch_add(&peer->received, 1);
+
+	if (peer->echo)
+		juice_send(agent, data, size);
+}
+
+static bool is_connected(juice_agent_t *agent) {
+	juice_state_t state = juice_get_state(agent);
+	return state == JUICE_STATE_CONNECTED || state == JUICE_STATE_COMPLETED;
+}
+
+static int create_peer(workload_peer_t *peer, const workload_options_t *wopts,
+                       juice_turn_server_t *turn_server) {
+	juice_config_t config;
+	memset(&config, 0, sizeof(config));
+	config.stun_server_host = wopts->host;
+	config.stun_server_port = wopts->port;
+	config.turn_servers = turn_server;
+	config.turn_servers_count = 1;
+	config.cb_candidate = on_candidate;
+	config.cb_gathering_done = on_gathering_done;
+	config.cb_recv = on_recv;
+	config.user_ptr = peer;
+
+	peer->agent = juice_create(&config);
+	return peer->agent ? 0 : -1;
+}
+
+// Allocates on both peers, relays messages for the configured duration, then releases
+// Returns the number of messages echoed back through the relay, or -1 on error
+static long run_relay_round(const workload_options_t *wopts, uint64_t *setup_ms) {
+	juice_turn_server_t turn_server;
+	memset(&turn_server, 0, sizeof(turn_server));
+	turn_server.host = wopts->host;
+	turn_server.port = wopts->port;
+	turn_server.username = wopts->username;
+	turn_server.password = wopts->password;
+
+	workload_peer_t first;
+	workload_peer_t second;
+	memset(&first, 0, sizeof(first));
+	memset(&second, 0, sizeof(second));
+	atomic_init(&first.received, 0);
+	atomic_init(&second.received, 0);
+	first.remote = &second;
+	second.remote = &first;
+	second.echo = true;
+
+	long result = -1;
+	uint64_t start = current_time_ms();
+	if (create_peer(&first, wopts, &turn_server) < 0 ||
+	    create_peer(&second, wopts, &turn_server) < 0) {
+		fprintf(stderr, "Agent creation failed\n");
+		goto cleanup;
+	}
+
+	char sdp[JUICE_MAX_SDP_STRING_LEN];
+	juice_get_local_description(first.agent, sdp, JUICE_MAX_SDP_STRING_LEN);
+	juice_set_remote_description(second.agent, sdp);
+	juice_get_local_description(second.agent, sdp, JUICE_MAX_SDP_STRING_LEN);
+	juice_set_remote_description(first.agent, sdp);
+
+	juice_gather_candidates(first.agent);
+	juice_gather_candidates(second.agent);
+
+	while (!is_connected(first.agent) || !is_connected(second.agent)) {
+		if (juice_get_state(first.agent) == JUICE_STATE_FAILED ||
+		    juice_get_state(second.agent) == JUICE_STATE_FAILED ||
+		    current_time_ms() - start > CONNECT_TIMEOUT_MS) {
+			fprintf(stderr, "Connectivity through the relay failed\n");
+			goto cleanup;
+		}
+		sleep_us(10000);
+	}
+
+	uint64_t now = current_time_ms();
+	*setup_ms += now - start;
+
+	char message[RELAY_MESSAGE_SIZE];
+	memset(message, 'V', RELAY_MESSAGE_SIZE);
+
+	unsigned long sent = 0;
+	unsigned long last_received = 0;
+	uint64_t last_progress = now;
+	uint64_t end = now + wopts->duration_ms;
+	while ((now = current_time_ms()) < end) {
+		unsigned long received = atomic_load(&first.received);
+		if (received != last_received) {
+			last_received = received;
+			last_progress = now;
+		} else if (now - last_progress > STALL_TIMEOUT_MS) {
+			// Consider in-flight messages lost and refill the window
+			sent = received;
+			last_progress = now;
+		}
+
+		if (received + RELAY_WINDOW > sent) {
+			if (juice_send(first.agent, message, RELAY_MESSAGE_SIZE) == 0)
+				++sent;
+		} else {
+			sleep_us(100);
+		}
+	}
+
+	result = (long)atomic_load(&first.received);
+
+cleanup:
+	if (first.agent)
+		juice_destroy(first.agent);
+	if (second.agent)
+		juice_destroy(second.agent);
+
+	return result;
+}
+
+static int run_relay(const workload_options_t *wopts) {
+	unsigned long messages = 0;
+	uint64_t setup_ms = 0;
+	for (int i = 0; i < wopts->rounds; ++i) {
+		long count = run_relay_round(wopts, &setup_ms);
+		if (count < 0)
+			return -1;
+
+		messages += (unsigned long)count;
+	}
+
+	printf("Allocate: %d rounds of 2 allocations, %.1f ms average setup\n", wopts->rounds,
+	       (double)setup_ms / wopts->rounds);
+	printf("Relay: %lu messages of %d bytes, %.0f messages/s\n", messages, RELAY_MESSAGE_SIZE,
+	       messages * 1000.0 / ((double)wopts->rounds * wopts->duration_ms));
+	return 0;
+}
+
+static void print_usage(const char *program_name) {
+	printf("Usage: %s [options]\n\n", program_name);
+	printf("  -a ADDRESS\tServer address (default 127.0.0.1)\n");
+	printf("  -p PORT\tServer port (default 3478)\n");
+	printf("  -c USER:PASS\tTURN credentials (default none, relay is skipped)\n");
+	printf("  -r ROUNDS\tNumber of allocation rounds (default 10)\n");
+	printf("  -d MS\t\tDuration of Binding and of each relay round (default 1000)\n");
+	printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+	workload_options_t wopts;
+	memset(&wopts, 0, sizeof(wopts));
+	wopts.host = "127.0.0.1";
+	wopts.port = 3478;
+	wopts.rounds = 10;
+	wopts.duration_ms = 1000;
+
+	int c;
+	while ((c = getopt(argc, argv, "a:p:c:r:d:h")) != -1) {
+		switch (c) {
+		case 'a':
+			wopts.host = optarg;
+			break;
+		case 'p':
+			wopts.port = (uint16_t)atoi(optarg);
+			break;
+		case 'c': {
+			char *s = strchr(optarg, ':');
+			if (!s) {
+				fprintf(stderr, "Credentials must be USER:PASS\n");
+				return EXIT_FAILURE;
+			}
+			*s = '\0';
+			wopts.username = optarg;
+			wopts.password = s + 1;
+			break;
+		}
+		case 'r':
+			wopts.rounds = atoi(optarg);
+			break;
+		case 'd':
+			wopts.duration_ms = atoi(optarg);
+			break;
+		case 'h':
+			print_usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (wopts.port == 0 || wopts.rounds <= 0 || wopts.duration_ms <= 0) {
+		fprintf(stderr, "Invalid arguments\n");
+		return EXIT_FAILURE;
+	}
+
+	juice_set_log_level(JUICE_LOG_LEVEL_WARN);
+
+	if (run_binding(&wopts) < 0)
+		return EXIT_FAILURE;
+
+	if (wopts.username && run_relay(&wopts) < 0)
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}